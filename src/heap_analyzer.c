@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "myAllocator.c"
+
+#define DEFAULT_MAP_WIDTH 64 // Number of characters of the occupancy map of each Arena
+#define MAX_MAP_WIDTH 4096    // Widest occupancy map accepted on the command line
+
+// Fragmentation figures of one Arena
+typedef struct arena_report {
+    size_t used_bytes;       // Bytes of allocated blocks
+    size_t free_bytes;       // Bytes of free blocks
+    size_t cached_bytes;     // Bytes of blocks held in thread caches or deferred free lists
+    size_t header_bytes;     // Bytes taken by block headers
+    size_t largest_free;     // Size of the largest free block
+    size_t free_count[MAX_BLOCK_CLASSES + 1];  // Number of free blocks of each category
+    size_t free_total[MAX_BLOCK_CLASSES + 1];  // Bytes of free blocks of each category
+} arena_report_t;
+
+// Compute the fragmentation figures of an Arena
+static void analyze_arena(const snapshot_arena_t* arena, arena_report_t* report) {
+    memset(report, 0, sizeof(*report));
+    for (size_t i = 0; i < arena->block_count; i++) {
+        const snapshot_block_t* block = &arena->blocks[i];
+        report->header_bytes += sizeof(block_t);
+        if (block->free == 1) {
+            report->free_bytes += block->size;
+            report->free_count[block->size_class]++;
+            report->free_total[block->size_class] += block->size;
+            if (block->size > report->largest_free) {
+                report->largest_free = block->size;
+            }
+        } else if (block->free == 2 || block->free == 3) {
+            report->cached_bytes += block->size;
+        } else {
+            report->used_bytes += block->size;
+        }
+    }
+}
+
+// Add the bytes from start to end to the regions they overlap
+static void add_region_bytes(size_t* counts, size_t region, size_t regions, size_t start, size_t end) {
+    while (start < end) {
+        size_t index = start / region;
+        if (index >= regions) break;
+        size_t region_end = (index + 1) * region;
+        size_t chunk = (end < region_end ? end : region_end) - start;
+        counts[index] += chunk;
+        start += chunk;
+    }
+}
+
+// Count the allocated bytes in each region of an Arena, block headers count as allocated
+static void count_used_bytes(const snapshot_arena_t* arena, size_t region, size_t* used, size_t regions) {
+    memset(used, 0, regions * sizeof(size_t));
+    for (size_t i = 0; i < arena->block_count; i++) {
+        const snapshot_block_t* block = &arena->blocks[i];
+        // Only the header of a free, cached or deferred block is allocated
+        size_t end = block->offset + sizeof(block_t) + (block->free ? 0 : block->size);
+        add_region_bytes(used, region, regions, block->offset, end);
+    }
+}
+
+// Count the payload bytes of cached or deferred blocks in each region of an Arena
+static void count_cached_bytes(const snapshot_arena_t* arena, size_t region, size_t* cached, size_t regions) {
+    memset(cached, 0, regions * sizeof(size_t));
+    for (size_t i = 0; i < arena->block_count; i++) {
+        const snapshot_block_t* block = &arena->blocks[i];
+        if (block->free != 2 && block->free != 3) continue;
+        size_t start = block->offset + sizeof(block_t);
+        add_region_bytes(cached, region, regions, start, start + block->size);
+    }
+}
+
+// Print the page utilisation of an Arena as one digit per page (0 = empty, 9 = full)
+static void print_page_utilisation(const snapshot_arena_t* arena, size_t page_size) {
+    size_t pages = (arena->size + page_size - 1) / page_size;
+    size_t* used = malloc(pages * sizeof(size_t));
+    if (!used) return;
+    count_used_bytes(arena, page_size, used, pages);
+
+    size_t empty_pages = 0;
+    printf("  page utilisation: ");
+    for (size_t i = 0; i < pages; i++) {
+        if (used[i] == 0) empty_pages++;
+        printf("%c", (char)('0' + used[i] * 9 / page_size));
+    }
+    printf("\n  pages without allocated bytes: %zu/%zu\n", empty_pages, pages);
+    free(used);
+}
+
+// Print the occupancy map of an Arena: '#' allocated, '.' free, '+' mixed,
+// 'c' mostly held in thread caches or deferred free lists
+static void print_occupancy_map(const snapshot_arena_t* arena, size_t width) {
+    size_t region = (arena->size + width - 1) / width;
+    char* map = malloc(width + 1);
+    size_t* used = malloc(width * sizeof(size_t));
+    size_t* cached = malloc(width * sizeof(size_t));
+    if (!map || !used || !cached) {
+        fprintf(stderr, "Failed to allocate the occupancy map\n");
+        free(map);
+        free(used);
+        free(cached);
+        return;
+    }
+    count_used_bytes(arena, region, used, width);
+    count_cached_bytes(arena, region, cached, width);
+
+    for (size_t i = 0; i < width; i++) {
+        size_t free_bytes = region - used[i] - cached[i];
+        // Cached bytes outweighing both the allocated and the free ones show the pinning, even
+        // when the region holds block headers
+        if (cached[i] > 0 && cached[i] >= used[i] && cached[i] >= free_bytes) map[i] = 'c';
+        else if (used[i] == region) map[i] = '#';
+        else if (used[i] > 0) map[i] = '+';
+        else map[i] = '.';
+    }
+    map[width] = '\0';
+    printf("  occupancy map: [%s] (%zu bytes per character)\n", map, region);
+    free(map);
+    free(used);
+    free(cached);
+}
+
+// Print the fragmentation report of a heap snapshot
+static void print_report(const heap_snapshot_t* snapshot, size_t width) {
+    for (size_t i = 0; i < snapshot->arena_count; i++) {
+        const snapshot_arena_t* arena = &snapshot->arenas[i];
+        arena_report_t report;
+        analyze_arena(arena, &report);
+
+        printf("Arena %zu at 0x%llx: %llu bytes, %llu blocks\n", i,
+               (unsigned long long)arena->address, (unsigned long long)arena->size,
+               (unsigned long long)arena->block_count);
+        printf("  allocated: %zu bytes, free: %zu bytes, cached or deferred: %zu bytes, headers: %zu bytes\n",
+               report.used_bytes, report.free_bytes, report.cached_bytes, report.header_bytes);
+        // External fragmentation: share of the free memory that the largest free block cannot serve
+        double fragmentation = report.free_bytes ? 1.0 - (double)report.largest_free / report.free_bytes : 0.0;
+        printf("  largest free block: %zu bytes, external fragmentation: %.1f%%\n",
+               report.largest_free, fragmentation * 100.0);
+
+        printf("  free blocks per size class:\n");
+        for (int c = 0; c <= MAX_BLOCK_CLASSES; c++) {
+            if (report.free_count[c] == 0) continue;
+            if (c < MAX_BLOCK_CLASSES) {
+                printf("    <= %5zu bytes: %5zu blocks, %8zu bytes\n", block_sizes[c],
+                       report.free_count[c], report.free_total[c]);
+            } else {
+                printf("     > %5zu bytes: %5zu blocks, %8zu bytes\n", block_sizes[MAX_BLOCK_CLASSES - 1],
+                       report.free_count[c], report.free_total[c]);
+            }
+        }
+
+        print_page_utilisation(arena, snapshot->page_size);
+        print_occupancy_map(arena, width);
+    }
+}
+
+// Print a heap snapshot as JSON
+static void print_json(const heap_snapshot_t* snapshot) {
+    printf("{\"arenas\":[");
+    for (size_t i = 0; i < snapshot->arena_count; i++) {
+        const snapshot_arena_t* arena = &snapshot->arenas[i];
+        printf("%s{\"address\":%llu,\"size\":%llu,\"blocks\":[", i ? "," : "",
+               (unsigned long long)arena->address, (unsigned long long)arena->size);
+        for (size_t j = 0; j < arena->block_count; j++) {
+            const snapshot_block_t* block = &arena->blocks[j];
+            printf("%s{\"offset\":%llu,\"size\":%llu,\"free\":%d,\"class\":%d}", j ? "," : "",
+                   (unsigned long long)block->offset, (unsigned long long)block->size,
+                   block->free, block->size_class);
+        }
+        printf("]}");
+    }
+    printf("]}\n");
+}
+
+static void print_usage(const char* program) {
+    fprintf(stderr, "Usage: %s <snapshot_file> [map_width|--json]\n", program);
+    fprintf(stderr, "  map_width: 1 to %d characters, %d by default\n", MAX_MAP_WIDTH, DEFAULT_MAP_WIDTH);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    int json = argc == 3 && strcmp(argv[2], "--json") == 0;
+    size_t width = DEFAULT_MAP_WIDTH;
+    if (argc == 3 && !json) {
+        char* end;
+        errno = 0;
+        long value = strtol(argv[2], &end, 10);
+        if (errno != 0 || end == argv[2] || *end != '\0' || value <= 0 || value > MAX_MAP_WIDTH) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        width = (size_t)value;
+    }
+
+    FILE* in = fopen(argv[1], "rb");
+    if (!in) {
+        perror("Failed to open heap snapshot file");
+        return 1;
+    }
+    heap_snapshot_t* snapshot = read_heap_snapshot(in);
+    fclose(in);
+    if (!snapshot) {
+        fprintf(stderr, "Invalid heap snapshot file\n");
+        return 1;
+    }
+
+    if (json) {
+        print_json(snapshot);
+    } else {
+        print_report(snapshot, width);
+    }
+
+    free_heap_snapshot(snapshot);
+    return 0;
+}
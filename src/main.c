@@ -48,5 +48,11 @@ int main(int argc,char **argv) {
     printf("Testing system allocator (multi-threaded, %d threads)...\n",num_threads);
     test_multithread_system_allocator_performance(num_allocations, num_threads, min_allocation_size, max_allocation_size);
 
+    printf("Testing fragmentation with mixed object lifetimes...\n");
+    test_mixed_lifetime_fragmentation(num_allocations / MIXED_LIFETIME_BUFFERS);
+
+    printf("Testing my_free latency with inline and deferred merges...\n");
+    test_free_latency(num_allocations / FREE_LATENCY_BLOCKS + 1);
+
     return 0;
 }
@@ -6,6 +6,9 @@
 #include <stddef.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 #define MAX_BLOCK_CLASSES 10    // Maximum number of block types
 #define PAGE_SIZE 4096          // Assume the system page size is 4096 bytes
@@ -13,13 +16,28 @@
 #define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1)) // Align Size
 #define ARENA_SIZE (PAGE_SIZE * 16) // The size of each Arena can be adjusted as needed
 #define THREAD_CACHE_MAX_BLOCKS 64 // Maximum number of blocks in thread cache for each block size
+#define MAINTENANCE_INTERVAL_MS 10 // Default period of the maintenance thread
+#define LIFETIME_SAMPLE_RATE 16  // One automatic allocation out of N is sampled to learn lifetimes
+#define LONG_LIFETIME_THRESHOLD 128 // Lifetime (in allocations of the thread) from which a block is long-lived
+#define LIFETIME_SCORE_MAX 16    // Bound of the per-category lifetime score
+#define HEAP_SNAPSHOT_MAGIC 0x50414e5350414548ULL // Marks a heap snapshot file ("HEAPSNAP")
+#define HEAP_SNAPSHOT_VERSION 1
+#define SHARED_ARENA_MAGIC 0x4d414c4c4f435348ULL // Marks an initialized shared Arena ("MALLOCSH")
+
+// Lifetime hints of my_malloc_hint
+#define MY_HINT_AUTO 0           // Let the allocator decide (short-lived unless lifetime learning says otherwise)
+#define MY_HINT_SHORT 1          // Short-lived object, placed in the main Arena of the thread
+#define MY_HINT_LONG 2           // Long-lived object, placed in the long-lived Arena of the thread
 
 // Memory block structure
 typedef struct block {
     size_t size;             // Block size
     struct block* next;      // Next Block
     struct block* prev;      // Previous block
-    int free;                // number 1 means free, 0 means allocated
+    int free;                // number 1 means free, 0 means allocated, 2 means held in a thread cache,
+                             // 3 means waiting in a deferred free list. It only becomes 1 or leaves 1 under
+                             // the Arena lock, other changes are relaxed atomic stores made without the lock
+    uint32_t birth;          // Allocation clock of a sampled allocated block, 0 if not sampled
 } block_t;
 
 // Arena structure, each thread has one or more Arena
@@ -29,6 +47,8 @@ typedef struct arena {
     void* memory;                     // Memory area managed by Arena
     size_t size;                      // Arena Size
     struct arena* next;               // Next Arena (for supporting multiple Arenas)
+    block_t* deferred;                // Lock-free stack of freed blocks waiting to be merged
+    size_t deferred_count;            // Number of blocks in the deferred stack
 } arena_t;
 
 // Thread Cache Structure
@@ -48,6 +68,25 @@ static const size_t block_sizes[MAX_BLOCK_CLASSES] = {8, 16, 32, 64, 128, 256, 5
 __thread arena_t* thread_arena = NULL;
 __thread thread_cache_t thread_cache = {{NULL}, {0}};
 
+// Thread local variables for lifetime segregation
+__thread arena_t* thread_long_arena = NULL; // Arena of the long-lived blocks of the thread
+__thread uint32_t thread_alloc_clock = 0;   // Number of automatic allocations while lifetime learning is on
+__thread int lifetime_score[MAX_BLOCK_CLASSES + 1]; // Positive when sampled blocks of a category live long
+
+// Learn lifetimes of automatic allocations from sampled frees
+static int lifetime_learning = 0;
+
+// Thread local variables for deferred frees
+__thread int thread_deferred_free = 0;             // Defer frees that would take the Arena lock
+__thread unsigned long thread_trim_epoch = 0;      // Last cache trim request handled by the thread
+
+// Background maintenance thread, it drains deferred frees and requests thread cache trimming
+static pthread_t maintenance_thread;
+static int maintenance_running = 0;
+static unsigned int maintenance_interval_ms = MAINTENANCE_INTERVAL_MS;
+static unsigned long cache_trim_epoch = 0;         // Incremented to ask threads to trim their cache
+static pthread_mutex_t maintenance_lock = PTHREAD_MUTEX_INITIALIZER;
+
 // Get block category index
 static int get_block_class(size_t size) {
     for (int i = 0; i < MAX_BLOCK_CLASSES; i++) {
@@ -58,6 +97,24 @@ static int get_block_class(size_t size) {
     return MAX_BLOCK_CLASSES; // Extra large block category
 }
 
+// Get the thread cache category of a free block: the largest category it can fully serve, -1 if none
+static int get_cache_class(size_t size) {
+    if (get_block_class(size) == MAX_BLOCK_CLASSES) {
+        return -1; // Extra large blocks are not cached
+    }
+    int class_index = -1;
+    for (int i = 0; i < MAX_BLOCK_CLASSES && block_sizes[i] <= size; i++) {
+        class_index = i;
+    }
+    return class_index;
+}
+
+// Get the category whose lifetime score applies to a block, the same one the thread cache uses
+static int get_lifetime_class(size_t size) {
+    int class_index = get_cache_class(size);
+    return class_index >= 0 ? class_index : get_block_class(size);
+}
+
 // Initialize the thread cache
 void init_thread_cache() {
     for (int i = 0; i < MAX_BLOCK_CLASSES; i++) {
@@ -87,6 +144,8 @@ arena_t* create_arena() {
     pthread_mutex_init(&arena->lock, NULL);
     memset(arena->free_list, 0, sizeof(arena->free_list));
     arena->next = NULL;
+    arena->deferred = NULL;
+    arena->deferred_count = 0;
 
     // Initialize the first block as the initial free block of the entire Arena
     block_t* initial_block = (block_t*)arena->memory;
@@ -104,24 +163,67 @@ arena_t* create_arena() {
     return arena;
 }
 
+// Create an Arena and add it to the global Arena list
+static arena_t* create_global_arena() {
+    // Lock to prevent multiple threads from creating Arena at the same time
+    pthread_mutex_lock(&global_arena_lock);
+    arena_t* arena = create_arena();
+    if (arena == NULL) {
+        pthread_mutex_unlock(&global_arena_lock);
+        return NULL;
+    }
+    // Add the new Arena to the global Arena list
+    arena->next = global_arena_list;
+    global_arena_list = arena;
+    pthread_mutex_unlock(&global_arena_lock);
+    return arena;
+}
+
 // Get the thread's Arena and create it if it does not exist
 arena_t* get_thread_arena() {
     if (thread_arena == NULL) {
-        // Lock to prevent multiple threads from creating Arena at the same time
-        pthread_mutex_lock(&global_arena_lock);
-        thread_arena = create_arena();
-        if (thread_arena == NULL) {
-            pthread_mutex_unlock(&global_arena_lock);
-            return NULL;
-        }
-        // Add the new Arena to the global Arena list
-        thread_arena->next = global_arena_list;
-        global_arena_list = thread_arena;
-        pthread_mutex_unlock(&global_arena_lock);
+        thread_arena = create_global_arena();
     }
     return thread_arena;
 }
 
+// Get the thread's long-lived Arena and create it if it does not exist
+arena_t* get_thread_long_arena() {
+    if (thread_long_arena == NULL) {
+        thread_long_arena = create_global_arena();
+    }
+    return thread_long_arena;
+}
+
+// Check whether a block lies in the memory of an Arena
+static int arena_contains(arena_t* arena, block_t* block) {
+    return (char*)block >= (char*)arena->memory && (char*)block < (char*)arena->memory + arena->size;
+}
+
+// Find the Arena owning a block, the Arenas of the current thread are checked first
+static arena_t* find_block_arena(block_t* block) {
+    if (thread_arena && arena_contains(thread_arena, block)) {
+        return thread_arena;
+    }
+    if (thread_long_arena && arena_contains(thread_long_arena, block)) {
+        return thread_long_arena;
+    }
+
+    // The block was allocated by another thread
+    pthread_mutex_lock(&global_arena_lock);
+    arena_t* arena = global_arena_list;
+    while (arena && !arena_contains(arena, block)) {
+        arena = arena->next;
+    }
+    pthread_mutex_unlock(&global_arena_lock);
+    return arena;
+}
+
+// Enable or disable lifetime learning for automatic allocations
+void my_malloc_set_lifetime_learning(int enable) {
+    __atomic_store_n(&lifetime_learning, enable ? 1 : 0, __ATOMIC_RELAXED);
+}
+
 // Add to free list (sorted by block size)
 void add_to_free_list(arena_t* arena, block_t* block) {
     int class_index = get_block_class(block->size);
@@ -178,29 +280,37 @@ void remove_from_free_list(arena_t* arena, block_t* block) {
     block->free = 0;
 }
 
-// Merge adjacent free blocks
-void coalesce_blocks(arena_t* arena, block_t* block) {
+// Merge adjacent free blocks, the previous block is searched from start, which must be a block
+// header located before block. Returns the resulting free block.
+static block_t* coalesce_blocks_from(arena_t* arena, block_t* block, block_t* start) {
     // Try to merge the next block
     block_t* next_block = (block_t*)((char*)block + block->size + sizeof(block_t));
-    if ((char*)next_block < (char*)arena->memory + arena->size && next_block->free) {
+    if ((char*)next_block < (char*)arena->memory + arena->size &&
+        __atomic_load_n(&next_block->free, __ATOMIC_RELAXED) == 1) {
         remove_from_free_list(arena, next_block);
         block->size += sizeof(block_t) + next_block->size;
     }
 
     // Try to merge the previous block
     block_t* prev_block = NULL;
-    block_t* current = (block_t*)arena->memory;
+    block_t* current = start;
     while ((char*)current < (char*)block) {
         prev_block = current;
         current = (block_t*)((char*)current + current->size + sizeof(block_t));
     }
-    if (prev_block && prev_block->free) {
+    if (prev_block && __atomic_load_n(&prev_block->free, __ATOMIC_RELAXED) == 1) {
         remove_from_free_list(arena, prev_block);
         prev_block->size += sizeof(block_t) + block->size;
         block = prev_block;
     }
 
     add_to_free_list(arena, block);
+    return block;
+}
+
+// Merge adjacent free blocks
+void coalesce_blocks(arena_t* arena, block_t* block) {
+    coalesce_blocks_from(arena, block, (block_t*)arena->memory);
 }
 
 // Find the best fit block
@@ -226,7 +336,7 @@ static void* allocate_from_thread_cache(int class_index) {
         block_t* block = thread_cache.free_list[class_index];
         thread_cache.free_list[class_index] = block->next;
         thread_cache.block_count[class_index]--;
-        block->free = 0; // Set to allocated
+        __atomic_store_n(&block->free, 0, __ATOMIC_RELAXED); // Set to allocated
         return (void*)((char*)block + sizeof(block_t));
     }
     return NULL;
@@ -234,36 +344,18 @@ static void* allocate_from_thread_cache(int class_index) {
 
 // Reclaim memory blocks to thread cache
 static int cache_block_to_thread(int class_index, block_t* block) {
-    if (thread_cache.block_count[class_index] < THREAD_CACHE_MAX_BLOCKS) {
+    if (class_index >= 0 && thread_cache.block_count[class_index] < THREAD_CACHE_MAX_BLOCKS) {
         block->next = thread_cache.free_list[class_index];
         thread_cache.free_list[class_index] = block;
         thread_cache.block_count[class_index]++;
-        block->free = 1; // Set to free
+        __atomic_store_n(&block->free, 2, __ATOMIC_RELAXED); // Set to cached, it must not be merged while in the thread cache
         return 1;
     }
     return 0;
 }
 
-// Memory allocation functions
-void* my_malloc(size_t size) {
-    if (size == 0) {
-        return NULL; // Unable to allocate 0 bytes
-    }
-
-    size = ALIGN(size); // 对齐大小
-    int class_index = get_block_class(size);
-
-    arena_t* arena = get_thread_arena();
-    if (!arena) {
-        return NULL;
-    }
-
-    // Prioritize allocation from thread cache
-    void* ptr = allocate_from_thread_cache(class_index);
-    if (ptr != NULL) {
-        return ptr;
-    }
-
+// Allocate a block from the free lists of an Arena
+static block_t* allocate_from_arena(arena_t* arena, size_t size, int class_index) {
     pthread_mutex_lock(&arena->lock);
 
     block_t* block = find_best_fit(arena, size, class_index);
@@ -290,23 +382,255 @@ void* my_malloc(size_t size) {
 
     block->free = 0;
     pthread_mutex_unlock(&arena->lock);
+    return block;
+}
+
+// Push a freed block on the deferred stack of its Arena, without taking the Arena lock
+static void defer_block(arena_t* arena, block_t* block) {
+    __atomic_store_n(&block->free, 3, __ATOMIC_RELAXED);
+    // Count the block first so the counter never drops below the real number of deferred blocks
+    __atomic_add_fetch(&arena->deferred_count, 1, __ATOMIC_RELAXED);
+    block_t* head = __atomic_load_n(&arena->deferred, __ATOMIC_RELAXED);
+    do {
+        block->next = head;
+    } while (!__atomic_compare_exchange_n(&arena->deferred, &head, block, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// Return the cached blocks of a category to the thread's main Arena
+static void flush_thread_cache_class(int class_index) {
+    if (!thread_arena || class_index >= MAX_BLOCK_CLASSES || !thread_cache.free_list[class_index]) {
+        return;
+    }
+
+    // A category can turn long-lived inside my_free, deferred mode must not merge inline here either
+    if (thread_deferred_free) {
+        while (thread_cache.free_list[class_index]) {
+            block_t* block = thread_cache.free_list[class_index];
+            thread_cache.free_list[class_index] = block->next;
+            defer_block(thread_arena, block);
+        }
+        thread_cache.block_count[class_index] = 0;
+        return;
+    }
+
+    pthread_mutex_lock(&thread_arena->lock);
+    while (thread_cache.free_list[class_index]) {
+        block_t* block = thread_cache.free_list[class_index];
+        thread_cache.free_list[class_index] = block->next;
+        block->free = 1;
+        coalesce_blocks(thread_arena, block);
+    }
+    thread_cache.block_count[class_index] = 0;
+    pthread_mutex_unlock(&thread_arena->lock);
+}
+
+// Update the lifetime score of the category of a sampled block being freed
+static void record_block_lifetime(block_t* block) {
+    int class_index = get_lifetime_class(block->size);
+    uint32_t lifetime = thread_alloc_clock - block->birth;
+    if (lifetime >= LONG_LIFETIME_THRESHOLD) {
+        if (lifetime_score[class_index] < LIFETIME_SCORE_MAX) lifetime_score[class_index]++;
+        if (lifetime_score[class_index] == 1) {
+            // The category just became long-lived, cached blocks of it would keep pinning the main Arena
+            flush_thread_cache_class(class_index);
+        }
+    } else {
+        if (lifetime_score[class_index] > -LIFETIME_SCORE_MAX) lifetime_score[class_index]--;
+    }
+    block->birth = 0;
+}
+
+// Sort a list of blocks linked by next in address order (merge sort)
+static block_t* sort_blocks_by_address(block_t* list) {
+    if (!list || !list->next) {
+        return list;
+    }
+
+    // Split the list in two halves
+    block_t* slow = list;
+    block_t* fast = list->next;
+    while (fast && fast->next) {
+        slow = slow->next;
+        fast = fast->next->next;
+    }
+    block_t* second = slow->next;
+    slow->next = NULL;
+
+    block_t* first = sort_blocks_by_address(list);
+    second = sort_blocks_by_address(second);
+
+    // Merge both sorted halves
+    block_t head;
+    block_t* tail = &head;
+    while (first && second) {
+        if (first < second) {
+            tail->next = first;
+            first = first->next;
+        } else {
+            tail->next = second;
+            second = second->next;
+        }
+        tail = tail->next;
+    }
+    tail->next = first ? first : second;
+    return head.next;
+}
+
+// Merge all deferred blocks of an Arena in a single pass over their sorted addresses
+static void drain_deferred_blocks(arena_t* arena) {
+    block_t* block = __atomic_exchange_n(&arena->deferred, NULL, __ATOMIC_ACQUIRE);
+    if (!block) {
+        return;
+    }
+    block = sort_blocks_by_address(block);
+
+    size_t count = 0;
+    pthread_mutex_lock(&arena->lock);
+    block_t* cursor = (block_t*)arena->memory;
+    while (block) {
+        block_t* next = block->next;
+        count++;
+        // Merge the following deferred blocks that are physically adjacent first
+        while (next && next == (block_t*)((char*)block + sizeof(block_t) + block->size)) {
+            block->size += sizeof(block_t) + next->size;
+            next = next->next;
+            count++;
+        }
+        block->free = 1;
+        // Later blocks have higher addresses, so the search for their previous block resumes here
+        cursor = coalesce_blocks_from(arena, block, cursor);
+        block = next;
+    }
+    pthread_mutex_unlock(&arena->lock);
+
+    // Released only once the blocks are merged, so a zero count means the merge is visible
+    __atomic_sub_fetch(&arena->deferred_count, count, __ATOMIC_RELEASE);
+}
+
+// Move the upper half of each thread cache category to the deferred stack of the main Arena
+static void trim_thread_cache() {
+    for (int i = 0; i < MAX_BLOCK_CLASSES; i++) {
+        while (thread_cache.block_count[i] > THREAD_CACHE_MAX_BLOCKS / 2) {
+            block_t* block = thread_cache.free_list[i];
+            thread_cache.free_list[i] = block->next;
+            thread_cache.block_count[i]--;
+            defer_block(thread_arena, block);
+        }
+    }
+}
+
+// Trim the thread cache if the maintenance thread asked for it since the last trim
+static void trim_thread_cache_if_requested() {
+    unsigned long epoch = __atomic_load_n(&cache_trim_epoch, __ATOMIC_RELAXED);
+    if (epoch != thread_trim_epoch) {
+        thread_trim_epoch = epoch;
+        if (thread_arena) {
+            trim_thread_cache();
+        }
+    }
+}
+
+// Allocate a block from an Arena, merging its deferred frees first if it is full
+static block_t* allocate_from_arena_or_deferred(arena_t* arena, size_t size, int class_index) {
+    block_t* block = allocate_from_arena(arena, size, class_index);
+    if (!block && __atomic_load_n(&arena->deferred, __ATOMIC_RELAXED)) {
+        // The missing space may be waiting in the deferred stack
+        drain_deferred_blocks(arena);
+        block = allocate_from_arena(arena, size, class_index);
+    }
+    return block;
+}
+
+// Memory allocation function with a lifetime hint (MY_HINT_AUTO, MY_HINT_SHORT or MY_HINT_LONG)
+void* my_malloc_hint(size_t size, int hint) {
+    if (size == 0) {
+        return NULL; // Unable to allocate 0 bytes
+    }
+
+    size = ALIGN(size); // 对齐大小
+    int class_index = get_block_class(size);
+    if (class_index < MAX_BLOCK_CLASSES) {
+        size = block_sizes[class_index]; // Round up to the category size so the block can be reused from the thread cache
+    }
+
+    // Sample some automatic allocations and place them according to what was learned
+    uint32_t birth = 0;
+    if (hint == MY_HINT_AUTO && __atomic_load_n(&lifetime_learning, __ATOMIC_RELAXED)) {
+        thread_alloc_clock++;
+        if (thread_alloc_clock % LIFETIME_SAMPLE_RATE == 0) {
+            birth = thread_alloc_clock;
+        }
+        if (lifetime_score[class_index] > 0) {
+            hint = MY_HINT_LONG;
+        }
+    }
+
+    block_t* block = NULL;
+    if (hint == MY_HINT_LONG) {
+        // Long-lived blocks bypass the thread cache, so they never end up among short-lived ones
+        arena_t* arena = get_thread_long_arena();
+        if (arena) {
+            block = allocate_from_arena_or_deferred(arena, size, class_index);
+        }
+        // A full long-lived Arena must not make the allocation fail, fall back to the main Arena
+    } else if (class_index < MAX_BLOCK_CLASSES) {
+        // Prioritize allocation from thread cache
+        void* ptr = allocate_from_thread_cache(class_index);
+        if (ptr != NULL) {
+            block = (block_t*)((char*)ptr - sizeof(block_t));
+        }
+    }
+    if (!block) {
+        arena_t* arena = get_thread_arena();
+        if (!arena) {
+            return NULL;
+        }
+        block = allocate_from_arena_or_deferred(arena, size, class_index);
+    }
+    if (!block) {
+        return NULL;
+    }
+
+    block->birth = birth;
     return (void*)((char*)block + sizeof(block_t));
 }
 
+// Memory allocation functions
+void* my_malloc(size_t size) {
+    return my_malloc_hint(size, MY_HINT_AUTO);
+}
+
 // Memory release function
 void my_free(void* ptr) {
     if (!ptr) return;
 
-    arena_t* arena = get_thread_arena();
+    block_t* block = (block_t*)((char*)ptr - sizeof(block_t));
+    arena_t* arena = find_block_arena(block);
     if (!arena) {
         return;
     }
 
-    block_t* block = (block_t*)((char*)ptr - sizeof(block_t));
-    int class_index = get_block_class(block->size);
+    if (block->birth) {
+        // The birth is a reading of the allocating thread's clock, another thread cannot score it
+        if (arena == thread_arena || arena == thread_long_arena) {
+            record_block_lifetime(block);
+        } else {
+            block->birth = 0;
+        }
+    }
+
+    // Prioritize recovery to thread cache, only short-lived blocks of the thread's main Arena are cached
+    int long_lived = __atomic_load_n(&lifetime_learning, __ATOMIC_RELAXED) &&
+                     lifetime_score[get_lifetime_class(block->size)] > 0;
+    if (arena == thread_arena && !long_lived && cache_block_to_thread(get_cache_class(block->size), block)) {
+        return;
+    }
 
-    // Prioritize recovery to thread cache
-    if (cache_block_to_thread(class_index, block)) {
+    // Latency-critical threads leave the merge to a quiescent point or to the maintenance thread
+    if (thread_deferred_free) {
+        defer_block(arena, block);
+        trim_thread_cache_if_requested();
         return;
     }
 
@@ -319,6 +643,81 @@ void my_free(void* ptr) {
     pthread_mutex_unlock(&arena->lock);
 }
 
+// Merge the deferred frees of the calling thread and trim its cache if requested,
+// to be called at a quiescent point of a latency-critical thread
+void my_malloc_quiesce() {
+    trim_thread_cache_if_requested();
+    if (thread_arena) {
+        drain_deferred_blocks(thread_arena);
+    }
+    if (thread_long_arena) {
+        drain_deferred_blocks(thread_long_arena);
+    }
+}
+
+// Enable or disable deferred frees for the calling thread, disabling them merges pending blocks
+void my_free_set_deferred(int enable) {
+    thread_deferred_free = enable ? 1 : 0;
+    if (!enable) {
+        my_malloc_quiesce();
+    }
+}
+
+// Merge the deferred frees of every Arena
+static void drain_all_deferred_blocks() {
+    // Arenas are only ever added at the head of the list, so it can be walked without the lock
+    pthread_mutex_lock(&global_arena_lock);
+    arena_t* arena = global_arena_list;
+    pthread_mutex_unlock(&global_arena_lock);
+
+    for (; arena; arena = arena->next) {
+        if (__atomic_load_n(&arena->deferred, __ATOMIC_RELAXED)) {
+            drain_deferred_blocks(arena);
+        }
+    }
+}
+
+// Main loop of the maintenance thread
+static void* maintenance_loop(void* arg) {
+    (void)arg;
+    while (__atomic_load_n(&maintenance_running, __ATOMIC_ACQUIRE)) {
+        drain_all_deferred_blocks();
+        // Thread caches are thread-local, each thread trims its own cache at its next deferred free
+        __atomic_add_fetch(&cache_trim_epoch, 1, __ATOMIC_RELAXED);
+        usleep(maintenance_interval_ms * 1000);
+    }
+    drain_all_deferred_blocks();
+    return NULL;
+}
+
+// Start the maintenance thread, returns 0 on success and -1 on failure
+int my_malloc_start_maintenance(unsigned int interval_ms) {
+    pthread_mutex_lock(&maintenance_lock);
+    if (maintenance_running) {
+        pthread_mutex_unlock(&maintenance_lock);
+        return 0;
+    }
+    maintenance_interval_ms = interval_ms ? interval_ms : MAINTENANCE_INTERVAL_MS;
+    __atomic_store_n(&maintenance_running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&maintenance_thread, NULL, maintenance_loop, NULL) != 0) {
+        __atomic_store_n(&maintenance_running, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&maintenance_lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&maintenance_lock);
+    return 0;
+}
+
+// Stop the maintenance thread, pending deferred frees are merged before it exits
+void my_malloc_stop_maintenance() {
+    pthread_mutex_lock(&maintenance_lock);
+    if (maintenance_running) {
+        __atomic_store_n(&maintenance_running, 0, __ATOMIC_RELEASE);
+        pthread_join(maintenance_thread, NULL);
+    }
+    pthread_mutex_unlock(&maintenance_lock);
+}
+
 // Check for memory leaks
 void check_memory_leaks() {
     pthread_mutex_lock(&global_arena_lock);
@@ -341,4 +740,541 @@ void check_memory_leaks() {
     }
 
     pthread_mutex_unlock(&global_arena_lock);
-}
\ No newline at end of file
+}
+
+// Block record of a heap snapshot
+typedef struct snapshot_block {
+    uint64_t offset;         // Offset of the block header from the start of the Arena memory
+    uint64_t size;           // Block size, without the header
+    uint8_t free;            // Same meaning as block_t.free
+    uint8_t size_class;      // Block category index
+    uint8_t reserved[6];     // Keeps records 8-byte aligned in the file
+} snapshot_block_t;
+
+// Arena record of a heap snapshot
+typedef struct snapshot_arena {
+    uint64_t address;        // Address of the Arena memory when the snapshot was taken
+    uint64_t size;           // Arena Size
+    uint64_t block_count;    // Number of block records
+    snapshot_block_t* blocks; // Block records sorted by offset (not stored in the file)
+} snapshot_arena_t;
+
+// Heap snapshot, a copy of the block layout of every Arena
+typedef struct heap_snapshot {
+    size_t page_size;        // PAGE_SIZE of the process that took the snapshot
+    size_t arena_count;      // Number of Arena records
+    snapshot_arena_t* arenas; // Arena records
+} heap_snapshot_t;
+
+// Snapshot file header, followed by each Arena record and its block records
+typedef struct snapshot_header {
+    uint64_t magic;          // HEAP_SNAPSHOT_MAGIC
+    uint32_t version;        // HEAP_SNAPSHOT_VERSION
+    uint32_t page_size;      // PAGE_SIZE of the process that took the snapshot
+    uint64_t arena_count;    // Number of Arena records
+} snapshot_header_t;
+
+// Release a heap snapshot
+void free_heap_snapshot(heap_snapshot_t* snapshot) {
+    if (!snapshot) return;
+    for (size_t i = 0; i < snapshot->arena_count; i++) {
+        free(snapshot->arenas[i].blocks);
+    }
+    free(snapshot->arenas);
+    free(snapshot);
+}
+
+// Copy the block layout of every Arena, each Arena lock is only held while its blocks are copied
+heap_snapshot_t* take_heap_snapshot() {
+    heap_snapshot_t* snapshot = calloc(1, sizeof(heap_snapshot_t));
+    if (!snapshot) return NULL;
+    snapshot->page_size = PAGE_SIZE;
+
+    pthread_mutex_lock(&global_arena_lock);
+
+    size_t arena_count = 0;
+    for (arena_t* arena = global_arena_list; arena; arena = arena->next) {
+        arena_count++;
+    }
+    snapshot->arenas = calloc(arena_count ? arena_count : 1, sizeof(snapshot_arena_t));
+    if (!snapshot->arenas) {
+        pthread_mutex_unlock(&global_arena_lock);
+        free(snapshot);
+        return NULL;
+    }
+
+    for (arena_t* arena = global_arena_list; arena; arena = arena->next) {
+        // Reserve room for the largest possible number of blocks before taking the lock
+        snapshot_block_t* blocks = malloc(arena->size / sizeof(block_t) * sizeof(snapshot_block_t));
+        if (!blocks) {
+            pthread_mutex_unlock(&global_arena_lock);
+            free_heap_snapshot(snapshot);
+            return NULL;
+        }
+
+        size_t count = 0;
+        pthread_mutex_lock(&arena->lock);
+        block_t* current = (block_t*)arena->memory;
+        while ((char*)current < (char*)arena->memory + arena->size) {
+            snapshot_block_t* record = &blocks[count++];
+            record->offset = (uint64_t)((char*)current - (char*)arena->memory);
+            record->size = current->size;
+            record->free = (uint8_t)current->free;
+            record->size_class = (uint8_t)get_block_class(current->size);
+            memset(record->reserved, 0, sizeof(record->reserved));
+            current = (block_t*)((char*)current + current->size + sizeof(block_t));
+        }
+        pthread_mutex_unlock(&arena->lock);
+
+        snapshot_arena_t* record = &snapshot->arenas[snapshot->arena_count++];
+        record->address = (uint64_t)(uintptr_t)arena->memory;
+        record->size = arena->size;
+        record->block_count = count;
+        record->blocks = blocks;
+    }
+
+    pthread_mutex_unlock(&global_arena_lock);
+    return snapshot;
+}
+
+// Write a heap snapshot in binary form, returns 0 on success and -1 on failure
+int write_heap_snapshot(const heap_snapshot_t* snapshot, FILE* out) {
+    snapshot_header_t header = {HEAP_SNAPSHOT_MAGIC, HEAP_SNAPSHOT_VERSION,
+                                 (uint32_t)snapshot->page_size, snapshot->arena_count};
+    if (fwrite(&header, sizeof(header), 1, out) != 1) {
+        return -1;
+    }
+    for (size_t i = 0; i < snapshot->arena_count; i++) {
+        const snapshot_arena_t* arena = &snapshot->arenas[i];
+        uint64_t fields[3] = {arena->address, arena->size, arena->block_count};
+        if (fwrite(fields, sizeof(fields), 1, out) != 1 ||
+            fwrite(arena->blocks, sizeof(snapshot_block_t), arena->block_count, out) != arena->block_count) {
+            return -1;
+        }
+    }
+    return fflush(out) == 0 ? 0 : -1;
+}
+
+// Check that a block record read from a file has a known state and category and lies in its Arena
+static int valid_snapshot_block(const snapshot_block_t* block, uint64_t arena_size) {
+    return block->free <= 3 && block->size_class <= MAX_BLOCK_CLASSES &&
+           block->offset <= arena_size && block->size <= arena_size &&
+           arena_size - block->offset >= sizeof(block_t) &&
+           arena_size - block->offset - sizeof(block_t) >= block->size;
+}
+
+// Read a heap snapshot written by write_heap_snapshot, returns NULL if the file is invalid
+heap_snapshot_t* read_heap_snapshot(FILE* in) {
+    snapshot_header_t header;
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        header.magic != HEAP_SNAPSHOT_MAGIC || header.version != HEAP_SNAPSHOT_VERSION) {
+        return NULL;
+    }
+
+    heap_snapshot_t* snapshot = calloc(1, sizeof(heap_snapshot_t));
+    if (!snapshot) return NULL;
+    snapshot->page_size = header.page_size ? header.page_size : PAGE_SIZE;
+    snapshot->arenas = calloc(header.arena_count ? header.arena_count : 1, sizeof(snapshot_arena_t));
+    if (!snapshot->arenas) {
+        free(snapshot);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < header.arena_count; i++) {
+        uint64_t fields[3];
+        if (fread(fields, sizeof(fields), 1, in) != 1 || fields[2] > fields[1] / sizeof(block_t)) {
+            free_heap_snapshot(snapshot);
+            return NULL;
+        }
+        snapshot_arena_t* arena = &snapshot->arenas[snapshot->arena_count++];
+        arena->address = fields[0];
+        arena->size = fields[1];
+        arena->block_count = fields[2];
+        arena->blocks = malloc((arena->block_count ? arena->block_count : 1) * sizeof(snapshot_block_t));
+        if (!arena->blocks ||
+            fread(arena->blocks, sizeof(snapshot_block_t), arena->block_count, in) != arena->block_count) {
+            free_heap_snapshot(snapshot);
+            return NULL;
+        }
+        for (size_t j = 0; j < arena->block_count; j++) {
+            if (!valid_snapshot_block(&arena->blocks[j], arena->size)) {
+                free_heap_snapshot(snapshot);
+                return NULL;
+            }
+        }
+    }
+    return snapshot;
+}
+
+// Take a heap snapshot and write it to a file, returns 0 on success and -1 on failure
+int dump_heap_snapshot(const char* path) {
+    heap_snapshot_t* snapshot = take_heap_snapshot();
+    if (!snapshot) {
+        return -1;
+    }
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        perror("Failed to open heap snapshot file");
+        free_heap_snapshot(snapshot);
+        return -1;
+    }
+    int ret = write_heap_snapshot(snapshot, out);
+    if (fclose(out) != 0) {
+        ret = -1;
+    }
+    free_heap_snapshot(snapshot);
+    return ret;
+}
+
+// ---------------------------------------------------------------------------
+// Shared Arenas: a region mapped MAP_SHARED by several processes, possibly at
+// different addresses. All links are offsets from the start of the mapping, so
+// a block allocated in one process can be handed to another as a plain offset.
+// ---------------------------------------------------------------------------
+
+// Shared memory block structure, offset 0 stands for "no block"
+typedef struct shared_block {
+    size_t size;             // Block size
+    size_t next;             // Offset of the next block in the free list
+    size_t prev;             // Offset of the previous block in the free list
+    int free;                // number 1 means free, 0 means allocated
+} shared_block_t;
+
+// Shared Arena header, stored at the start of the mapping itself
+typedef struct shared_arena {
+    uint64_t magic;                          // SHARED_ARENA_MAGIC once initialized
+    pthread_mutex_t lock;                    // Process-shared robust lock protecting the Arena
+    size_t size;                             // Size of the whole mapping
+    size_t memory;                           // Offset of the first block
+    size_t free_list[MAX_BLOCK_CLASSES + 1]; // Offsets of the free list heads
+} shared_arena_t;
+
+#define SHARED_BLOCK(arena, off) ((shared_block_t*)((char*)(arena) + (off)))
+#define SHARED_OFFSET(arena, block) ((size_t)((char*)(block) - (char*)(arena)))
+
+// Add to shared free list (sorted by block size)
+static void shared_add_to_free_list(shared_arena_t* arena, shared_block_t* block) {
+    int class_index = get_block_class(block->size);
+    size_t* head = &arena->free_list[class_index];
+    size_t offset = SHARED_OFFSET(arena, block);
+
+    size_t current = *head;
+    size_t prev = 0;
+    while (current && SHARED_BLOCK(arena, current)->size < block->size) {
+        prev = current;
+        current = SHARED_BLOCK(arena, current)->next;
+    }
+
+    block->next = current;
+    block->prev = prev;
+    if (current) {
+        SHARED_BLOCK(arena, current)->prev = offset;
+    }
+    if (prev) {
+        SHARED_BLOCK(arena, prev)->next = offset;
+    } else {
+        *head = offset;
+    }
+
+    block->free = 1;
+}
+
+// Remove a block from the shared free list
+static void shared_remove_from_free_list(shared_arena_t* arena, shared_block_t* block) {
+    int class_index = get_block_class(block->size);
+    if (block->prev) {
+        SHARED_BLOCK(arena, block->prev)->next = block->next;
+    } else {
+        arena->free_list[class_index] = block->next;
+    }
+    if (block->next) {
+        SHARED_BLOCK(arena, block->next)->prev = block->prev;
+    }
+    block->next = 0;
+    block->prev = 0;
+    block->free = 0;
+}
+
+// Merge adjacent free blocks of a shared Arena, prev_block is the block physically before block or NULL
+static void shared_coalesce_blocks(shared_arena_t* arena, shared_block_t* block, shared_block_t* prev_block) {
+    char* end = (char*)arena + arena->size;
+
+    // Try to merge the next block
+    shared_block_t* next_block = (shared_block_t*)((char*)block + block->size + sizeof(shared_block_t));
+    if ((char*)next_block < end && next_block->free) {
+        shared_remove_from_free_list(arena, next_block);
+        block->size += sizeof(shared_block_t) + next_block->size;
+    }
+
+    // Try to merge the previous block
+    if (prev_block && prev_block->free) {
+        shared_remove_from_free_list(arena, prev_block);
+        prev_block->size += sizeof(shared_block_t) + block->size;
+        block = prev_block;
+    }
+
+    shared_add_to_free_list(arena, block);
+}
+
+// Rebuild the free lists of a shared Arena from its block headers, merging adjacent free blocks.
+// Returns -1 when the headers themselves are inconsistent.
+static int shared_rebuild_free_lists(shared_arena_t* arena) {
+    // Check that the headers tile the Arena before touching anything
+    size_t offset = arena->memory;
+    while (offset < arena->size) {
+        shared_block_t* block = SHARED_BLOCK(arena, offset);
+        if (block->size % ALIGNMENT != 0 || (block->free != 0 && block->free != 1) ||
+            block->size > arena->size - offset - sizeof(shared_block_t)) {
+            return -1;
+        }
+        offset += sizeof(shared_block_t) + block->size;
+    }
+    if (offset != arena->size) {
+        return -1;
+    }
+
+    for (int i = 0; i <= MAX_BLOCK_CLASSES; i++) {
+        arena->free_list[i] = 0;
+    }
+    offset = arena->memory;
+    while (offset < arena->size) {
+        shared_block_t* block = SHARED_BLOCK(arena, offset);
+        if (block->free) {
+            // A block freed but not merged yet may be followed by other free blocks
+            size_t next = offset + sizeof(shared_block_t) + block->size;
+            while (next < arena->size && SHARED_BLOCK(arena, next)->free) {
+                block->size += sizeof(shared_block_t) + SHARED_BLOCK(arena, next)->size;
+                next = offset + sizeof(shared_block_t) + block->size;
+            }
+            shared_add_to_free_list(arena, block);
+        }
+        offset += sizeof(shared_block_t) + block->size;
+    }
+    return 0;
+}
+
+// Lock a shared Arena, recovering the lock if its previous owner died
+static int shared_arena_lock(shared_arena_t* arena) {
+    int ret = pthread_mutex_lock(&arena->lock);
+    if (ret == EOWNERDEAD) {
+        // The owner process died while holding the lock, its free list updates may be half done
+        if (shared_rebuild_free_lists(arena) != 0) {
+            // Unlocking without marking the lock consistent makes the Arena unusable for every process
+            pthread_mutex_unlock(&arena->lock);
+            return ENOTRECOVERABLE;
+        }
+        pthread_mutex_consistent(&arena->lock);
+        ret = 0;
+    }
+    return ret;
+}
+
+// Map a shared Arena from a file descriptor, initializing it when init is set
+static shared_arena_t* shared_arena_map(int fd, size_t size, int init) {
+    if (!init) {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            perror("Failed to stat shared arena");
+            return NULL;
+        }
+        size = (size_t)st.st_size;
+    }
+    if (size < sizeof(shared_arena_t) + sizeof(shared_block_t) + ALIGNMENT) {
+        fprintf(stderr, "Shared arena size %zu is too small\n", size);
+        return NULL;
+    }
+
+    size &= ~(size_t)(ALIGNMENT - 1); // Keep every block boundary aligned up to the end of the mapping
+    if (init && ftruncate(fd, (off_t)size) != 0) {
+        perror("Failed to resize shared arena");
+        return NULL;
+    }
+
+    shared_arena_t* arena = (shared_arena_t*)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED, fd, 0);
+    if (arena == MAP_FAILED) {
+        perror("Failed to map shared arena");
+        return NULL;
+    }
+
+    if (!init) {
+        if (__atomic_load_n(&arena->magic, __ATOMIC_ACQUIRE) != SHARED_ARENA_MAGIC || arena->size != size) {
+            fprintf(stderr, "Shared arena is not initialized\n");
+            munmap(arena, size);
+            return NULL;
+        }
+        return arena;
+    }
+
+    // The lock must work across processes and survive a process dying while holding it
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&arena->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    arena->size = size;
+    arena->memory = ALIGN(sizeof(shared_arena_t));
+    memset(arena->free_list, 0, sizeof(arena->free_list));
+
+    // Initialize the first block as the initial free block of the entire Arena
+    shared_block_t* initial_block = SHARED_BLOCK(arena, arena->memory);
+    initial_block->size = size - arena->memory - sizeof(shared_block_t);
+    initial_block->next = 0;
+    initial_block->prev = 0;
+    initial_block->free = 1;
+    shared_add_to_free_list(arena, initial_block);
+
+    // Publish the Arena only once it is fully initialized
+    __atomic_store_n(&arena->magic, SHARED_ARENA_MAGIC, __ATOMIC_RELEASE);
+    return arena;
+}
+
+// Create a shared Arena in a file or memory object opened by the caller
+shared_arena_t* shared_arena_create_fd(int fd, size_t size) {
+    return shared_arena_map(fd, size, 1);
+}
+
+// Attach to a shared Arena previously created in the given file or memory object
+shared_arena_t* shared_arena_attach_fd(int fd) {
+    return shared_arena_map(fd, 0, 0);
+}
+
+// Create a shared Arena backed by a POSIX shared memory object.
+// With a NULL name the object is unlinked immediately: it is then only reachable
+// by processes forked after the call.
+shared_arena_t* shared_arena_create(const char* name, size_t size) {
+    char anonymous_name[64];
+    if (name == NULL) {
+        static int anonymous_count = 0;
+        snprintf(anonymous_name, sizeof(anonymous_name), "/myAllocator-%d-%d",
+                 (int)getpid(), __atomic_fetch_add(&anonymous_count, 1, __ATOMIC_RELAXED));
+    }
+
+    int fd = shm_open(name ? name : anonymous_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        perror("Failed to open shared memory object");
+        return NULL;
+    }
+    if (name == NULL) {
+        shm_unlink(anonymous_name);
+    }
+
+    shared_arena_t* arena = shared_arena_create_fd(fd, size);
+    close(fd); // The mapping keeps the object alive
+    if (arena == NULL && name != NULL) {
+        shm_unlink(name);
+    }
+    return arena;
+}
+
+// Attach to a named shared Arena created by another process
+shared_arena_t* shared_arena_attach(const char* name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        perror("Failed to open shared memory object");
+        return NULL;
+    }
+    shared_arena_t* arena = shared_arena_attach_fd(fd);
+    close(fd);
+    return arena;
+}
+
+// Unmap a shared Arena from the calling process, other processes are not affected
+void shared_arena_detach(shared_arena_t* arena) {
+    if (arena) {
+        munmap(arena, arena->size);
+    }
+}
+
+// Allocate memory in a shared Arena, returns the offset of the data or 0 on failure
+size_t shared_malloc(shared_arena_t* arena, size_t size) {
+    // Sizes close to SIZE_MAX would wrap around to 0 when aligned
+    if (!arena || size == 0 || size > arena->size) {
+        return 0;
+    }
+
+    size = ALIGN(size);
+    int class_index = get_block_class(size);
+
+    if (shared_arena_lock(arena) != 0) {
+        return 0;
+    }
+
+    // Find the first fit, starting from the requested category
+    shared_block_t* block = NULL;
+    for (int i = class_index; i <= MAX_BLOCK_CLASSES && !block; i++) {
+        size_t current = arena->free_list[i];
+        while (current) {
+            if (SHARED_BLOCK(arena, current)->size >= size) {
+                block = SHARED_BLOCK(arena, current);
+                break;
+            }
+            current = SHARED_BLOCK(arena, current)->next;
+        }
+    }
+    if (!block) {
+        pthread_mutex_unlock(&arena->lock);
+        return 0;
+    }
+    shared_remove_from_free_list(arena, block);
+
+    // If the block is much larger than the requested size, split the block
+    if (block->size > size + sizeof(shared_block_t) + ALIGNMENT) {
+        shared_block_t* new_block = (shared_block_t*)((char*)block + sizeof(shared_block_t) + size);
+        new_block->size = block->size - size - sizeof(shared_block_t);
+        new_block->free = 1;
+        block->size = size;
+        shared_add_to_free_list(arena, new_block);
+    }
+
+    block->free = 0;
+    pthread_mutex_unlock(&arena->lock);
+    return SHARED_OFFSET(arena, block) + sizeof(shared_block_t);
+}
+
+// Release memory of a shared Arena, from any process attached to it
+void shared_free(shared_arena_t* arena, size_t offset) {
+    if (!arena || offset == 0) {
+        return;
+    }
+    // Ignore offsets that cannot come from shared_malloc on this Arena
+    if (offset < arena->memory + sizeof(shared_block_t) || offset >= arena->size || offset % ALIGNMENT != 0) {
+        return;
+    }
+
+    if (shared_arena_lock(arena) != 0) {
+        return;
+    }
+
+    // Walk the headers to make sure the offset is the start of a block, a stale or forged offset
+    // may point into a live block whose bytes only look like a header
+    size_t target = offset - sizeof(shared_block_t);
+    size_t current = arena->memory;
+    shared_block_t* prev_block = NULL;
+    while (current < target) {
+        prev_block = SHARED_BLOCK(arena, current);
+        current += sizeof(shared_block_t) + prev_block->size;
+    }
+    shared_block_t* block = SHARED_BLOCK(arena, target);
+    if (current != target || block->free != 0) {
+        // Not the start of a block, or a double free
+        pthread_mutex_unlock(&arena->lock);
+        return;
+    }
+    block->free = 1;
+    shared_coalesce_blocks(arena, block, prev_block);
+
+    pthread_mutex_unlock(&arena->lock);
+}
+
+// Convert an offset returned by shared_malloc to an address in the calling process
+void* shared_offset_to_ptr(shared_arena_t* arena, size_t offset) {
+    return offset ? (void*)((char*)arena + offset) : NULL;
+}
+
+// Convert an address inside a shared Arena to an offset valid in every process
+size_t shared_ptr_to_offset(shared_arena_t* arena, void* ptr) {
+    return ptr ? SHARED_OFFSET(arena, ptr) : 0;
+}
@@ -183,4 +183,188 @@ void test_multithread_system_allocator_performance(int num_allocations,int num_t
     printf("Custom Allocator (my_malloc/my_free): %d threads, %d allocations, "
            "sizes between %zu and %zu bytes took %f seconds\n",
            num_threads,num_allocations,min_allocation_size,max_allocation_size,time_spent);
-}
\ No newline at end of file
+}
+
+#define MIXED_LIFETIME_CACHE_ENTRIES 40 // Number of long-lived entries kept alive by the mixed-lifetime test
+#define MIXED_LIFETIME_BUFFERS 8        // Number of short-lived buffers allocated per round
+
+// Allocation mode and results of a mixed-lifetime test thread
+typedef struct{
+    int rounds;
+    int mode;                 // 0 no hint, 1 explicit hints, 2 lifetime learning
+    int failures;             // Number of failed allocations
+    size_t live_pages;        // Pages of the thread's Arenas holding allocated bytes
+    size_t largest_free;      // Largest free block of the thread's main Arena
+    size_t total_free;        // Free bytes of the thread's main Arena
+}mixed_lifetime_data_t;
+
+// Measure the Arenas of the calling thread from a heap snapshot
+static void measure_thread_arenas(mixed_lifetime_data_t* data) {
+    heap_snapshot_t* snapshot = take_heap_snapshot();
+    if (!snapshot) return;
+    for (size_t i = 0; i < snapshot->arena_count; i++) {
+        snapshot_arena_t* arena = &snapshot->arenas[i];
+        int is_main = thread_arena && arena->address == (uint64_t)(uintptr_t)thread_arena->memory;
+        int is_long = thread_long_arena && arena->address == (uint64_t)(uintptr_t)thread_long_arena->memory;
+        if (!is_main && !is_long) continue;
+
+        size_t last_page = (size_t)-1;
+        for (size_t j = 0; j < arena->block_count; j++) {
+            snapshot_block_t* block = &arena->blocks[j];
+            if (block->free == 0) {
+                // Count every page touched by the allocated block once
+                size_t first = block->offset / PAGE_SIZE;
+                size_t last = (block->offset + sizeof(block_t) + block->size - 1) / PAGE_SIZE;
+                data->live_pages += last - first + 1 - (first == last_page ? 1 : 0);
+                last_page = last;
+            } else if (block->free == 1 && is_main) {
+                data->total_free += block->size;
+                if (block->size > data->largest_free) data->largest_free = block->size;
+            }
+        }
+    }
+    free_heap_snapshot(snapshot);
+}
+
+// Request buffers are freed at the end of each round, cache entries live for many rounds
+void *thread_task_mixed_lifetime(void *arg)
+{
+    mixed_lifetime_data_t* data=(mixed_lifetime_data_t*)arg;
+    int short_hint = data->mode == 1 ? MY_HINT_SHORT : MY_HINT_AUTO;
+    int long_hint = data->mode == 1 ? MY_HINT_LONG : MY_HINT_AUTO;
+    void* cache[MIXED_LIFETIME_CACHE_ENTRIES] = {NULL};
+    unsigned int seed = 42;
+
+    for (int round = 0; round < data->rounds; round++) {
+        void* buffers[MIXED_LIFETIME_BUFFERS];
+        for (int i = 0; i < MIXED_LIFETIME_BUFFERS; i++) {
+            buffers[i] = my_malloc_hint(4200 + rand_r(&seed) % 800, short_hint);
+            if (buffers[i] == NULL) data->failures++;
+
+            // Replace the oldest cache entry in the middle of the request
+            if (i == MIXED_LIFETIME_BUFFERS / 2) {
+                int slot = round % MIXED_LIFETIME_CACHE_ENTRIES;
+                my_free(cache[slot]);
+                cache[slot] = my_malloc_hint(64 + rand_r(&seed) % 64, long_hint);
+                if (cache[slot] == NULL) data->failures++;
+            }
+        }
+        for (int i = 0; i < MIXED_LIFETIME_BUFFERS; i++) {
+            my_free(buffers[i]);
+        }
+    }
+
+    measure_thread_arenas(data);
+    for (int i = 0; i < MIXED_LIFETIME_CACHE_ENTRIES; i++) {
+        my_free(cache[i]);
+    }
+    pthread_exit(NULL);
+}
+
+// Compare fragmentation of a mixed-lifetime workload without hints, with hints and with lifetime learning
+void test_mixed_lifetime_fragmentation(int rounds)
+{
+    const char* names[3] = {"no hint", "explicit hints", "lifetime learning"};
+    for (int mode = 0; mode < 3; mode++) {
+        mixed_lifetime_data_t data = {rounds, mode, 0, 0, 0, 0};
+        pthread_t thread;
+
+        my_malloc_set_lifetime_learning(mode == 2);
+        // A new thread starts with empty Arenas
+        pthread_create(&thread, NULL, thread_task_mixed_lifetime, &data);
+        pthread_join(thread, NULL);
+
+        double fragmentation = data.total_free ? 1.0 - (double)data.largest_free / data.total_free : 0.0;
+        printf("Mixed lifetimes (%s): %d rounds, %d failed allocations, %zu pages holding live data, "
+               "largest free block %zu of %zu free bytes (external fragmentation %.1f%%)\n",
+               names[mode], rounds, data.failures, data.live_pages,
+               data.largest_free, data.total_free, fragmentation * 100.0);
+    }
+    my_malloc_set_lifetime_learning(0);
+}
+
+
+#define FREE_LATENCY_BLOCKS 200 // Blocks allocated then freed in each round of the free latency test
+
+// Free mode and results of a free latency test thread
+typedef struct{
+    int rounds;
+    int mode;                 // 0 inline merge, 1 deferred with my_malloc_quiesce, 2 deferred with the maintenance thread
+    long* latencies;          // Latency of each my_free call in nanoseconds
+    int count;                // Number of measured my_free calls
+}free_latency_data_t;
+
+// Compare two latencies for qsort
+static int compare_latency(const void* a, const void* b) {
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+// Allocate more blocks than the thread cache holds and time each my_free in a shuffled order
+void *thread_task_free_latency(void *arg)
+{
+    free_latency_data_t* data=(free_latency_data_t*)arg;
+    void* ptrs[FREE_LATENCY_BLOCKS];
+    unsigned int seed = 42;
+    struct timespec start, end;
+
+    my_free_set_deferred(data->mode != 0);
+    for (int round = 0; round < data->rounds; round++) {
+        for (int i = 0; i < FREE_LATENCY_BLOCKS; i++) {
+            ptrs[i] = my_malloc(16 + rand_r(&seed) % 240);
+        }
+        // Shuffle the blocks so that neighbours are not freed one after another
+        for (int i = FREE_LATENCY_BLOCKS - 1; i > 0; i--) {
+            int j = rand_r(&seed) % (i + 1);
+            void* tmp = ptrs[i];
+            ptrs[i] = ptrs[j];
+            ptrs[j] = tmp;
+        }
+        for (int i = 0; i < FREE_LATENCY_BLOCKS; i++) {
+            if (ptrs[i] == NULL) continue;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            my_free(ptrs[i]);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            data->latencies[data->count++] = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+        }
+        if (data->mode == 1) {
+            my_malloc_quiesce(); // Quiescent point of the event loop, outside the measured frees
+        }
+    }
+    my_free_set_deferred(0);
+    pthread_exit(NULL);
+}
+
+// Compare my_free latency percentiles with inline merges and with deferred merges
+void test_free_latency(int rounds)
+{
+    const char* names[3] = {"inline merge", "deferred, my_malloc_quiesce", "deferred, maintenance thread"};
+    for (int mode = 0; mode < 3; mode++) {
+        free_latency_data_t data = {rounds, mode, malloc((size_t)rounds * FREE_LATENCY_BLOCKS * sizeof(long)), 0};
+        if (data.latencies == NULL) {
+            fprintf(stderr, "Failed to allocate latency buffer\n");
+            return;
+        }
+        pthread_t thread;
+
+        if (mode == 2) {
+            my_malloc_start_maintenance(1);
+        }
+        // A new thread starts with empty Arenas
+        pthread_create(&thread, NULL, thread_task_free_latency, &data);
+        pthread_join(thread, NULL);
+        if (mode == 2) {
+            my_malloc_stop_maintenance();
+        }
+
+        if (data.count > 0) {
+            qsort(data.latencies, data.count, sizeof(long), compare_latency);
+            printf("my_free latency (%s): %d frees, p50 %ld ns, p99 %ld ns, p99.9 %ld ns, max %ld ns\n",
+                   names[mode], data.count, data.latencies[data.count / 2],
+                   data.latencies[(int)(data.count * 0.99)], data.latencies[(int)(data.count * 0.999)],
+                   data.latencies[data.count - 1]);
+        }
+        free(data.latencies);
+    }
+}
@@ -4,6 +4,7 @@
 #include <cmocka.h>
 #include "../src/myAllocator.c"
 #include <pthread.h>
+#include <sys/wait.h>
 
 static void* thread_test(void* arg) {
     (void)arg;
@@ -138,6 +139,670 @@ static void test_block_coalescing(void **state) {
     my_free(ptr3);
 }
 
+// Test that blocks freed to the thread cache are reused by requests of the same size
+static void test_thread_cache_reuse(void **state) {
+    void *ptr1 = my_malloc(1500);
+    assert_non_null(ptr1);
+    my_free(ptr1);
+    void *ptr2 = my_malloc(1500);
+    assert_ptr_equal(ptr2, ptr1);
+    my_free(ptr2);
+
+    // Random sizes must not exhaust the Arena while everything is freed right away
+    unsigned int seed = 1;
+    for (int i = 0; i < 10000; i++) {
+        size_t size = 16 + rand_r(&seed) % 4081;
+        void *ptr = my_malloc(size);
+        assert_non_null(ptr);
+        memset(ptr, 0xab, size);
+        my_free(ptr);
+    }
+}
+
+// Allocate short-lived blocks around a long-lived one in a fresh thread
+static void* lifetime_hint_thread(void* arg) {
+    (void)arg;
+    void *short1 = my_malloc_hint(5000, MY_HINT_SHORT);
+    void *long1 = my_malloc_hint(64, MY_HINT_LONG);
+    void *short2 = my_malloc_hint(5000, MY_HINT_SHORT);
+    assert_non_null(short1);
+    assert_non_null(long1);
+    assert_non_null(short2);
+
+    // Each lifetime has its own Arena
+    assert_true(arena_contains(thread_arena, (block_t *)short1));
+    assert_true(arena_contains(thread_arena, (block_t *)short2));
+    assert_true(arena_contains(thread_long_arena, (block_t *)long1));
+
+    // The long-lived block does not pin the space between the short-lived ones
+    my_free(short1);
+    my_free(short2);
+    void *whole = my_malloc_hint(ARENA_SIZE - sizeof(block_t), MY_HINT_SHORT);
+    assert_non_null(whole);
+
+    my_free(whole);
+    my_free(long1);
+    return NULL;
+}
+
+// Test that lifetime hints place blocks in separate Arenas
+static void test_lifetime_hint(void **state) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, lifetime_hint_thread, NULL);
+    pthread_join(thread, NULL);
+}
+
+// Fill the long-lived Arena of a fresh thread and keep allocating long-lived blocks
+static void* long_arena_full_thread(void* arg) {
+    (void)arg;
+    void *ptrs[600];
+    int in_main = 0;
+    for (int i = 0; i < 600; i++) {
+        ptrs[i] = my_malloc_hint(100, MY_HINT_LONG);
+        assert_non_null(ptrs[i]);
+        if (!arena_contains(thread_long_arena, (block_t *)ptrs[i])) {
+            // The main Arena is only created by the first fallback
+            assert_non_null(thread_arena);
+            assert_true(arena_contains(thread_arena, (block_t *)ptrs[i]));
+            in_main++;
+        }
+    }
+    // 600 blocks of 128 bytes do not fit in one Arena, the rest went to the main Arena
+    assert_true(in_main > 0);
+
+    for (int i = 0; i < 600; i++) {
+        my_free(ptrs[i]);
+    }
+    return NULL;
+}
+
+// Test that long-lived allocations fall back to the main Arena when the long-lived one is full
+static void test_lifetime_hint_fallback(void **state) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, long_arena_full_thread, NULL);
+    pthread_join(thread, NULL);
+}
+
+// Keep small blocks alive for many allocations while large ones are freed immediately
+static void* lifetime_learning_thread(void* arg) {
+    (void)arg;
+    void *ring[40] = {NULL};
+    for (int round = 0; round < 800; round++) {
+        void *buffers[8];
+        for (int i = 0; i < 8; i++) {
+            buffers[i] = my_malloc(5000);
+            assert_non_null(buffers[i]);
+        }
+        my_free(ring[round % 40]);
+        ring[round % 40] = my_malloc(100);
+        assert_non_null(ring[round % 40]);
+        for (int i = 0; i < 8; i++) {
+            my_free(buffers[i]);
+        }
+    }
+
+    assert_true(lifetime_score[get_block_class(ALIGN(100))] > 0);
+    assert_true(lifetime_score[get_block_class(5000)] < 0);
+
+    // Blocks of the long-lived category are now placed in the long-lived Arena
+    void *ptr = my_malloc(100);
+    assert_true(arena_contains(thread_long_arena, (block_t *)ptr));
+    my_free(ptr);
+
+    for (int i = 0; i < 40; i++) {
+        my_free(ring[i]);
+    }
+    return NULL;
+}
+
+// Test that lifetime learning detects long-lived categories
+static void test_lifetime_learning(void **state) {
+    my_malloc_set_lifetime_learning(1);
+    pthread_t thread;
+    pthread_create(&thread, NULL, lifetime_learning_thread, NULL);
+    pthread_join(thread, NULL);
+    my_malloc_set_lifetime_learning(0);
+}
+
+// Free blocks allocated by another thread without allocating anything first
+static void* lifetime_foreign_free_thread(void* arg) {
+    void **ptrs = (void **)arg;
+    for (int i = 0; i < 64; i++) {
+        my_free(ptrs[i]);
+    }
+    // The sampled blocks belong to another thread's clock and must not be scored
+    assert_int_equal(lifetime_score[get_lifetime_class(512)], 0);
+    return NULL;
+}
+
+// Allocate sampled blocks and let another thread free them
+static void* lifetime_foreign_alloc_thread(void* arg) {
+    (void)arg;
+    void *ptrs[64];
+    for (int i = 0; i < 64; i++) {
+        ptrs[i] = my_malloc(512);
+        assert_non_null(ptrs[i]);
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, lifetime_foreign_free_thread, ptrs);
+    pthread_join(thread, NULL);
+    return NULL;
+}
+
+// Test that blocks freed by another thread do not update its lifetime scores
+static void test_lifetime_foreign_free(void **state) {
+    my_malloc_set_lifetime_learning(1);
+    pthread_t thread;
+    pthread_create(&thread, NULL, lifetime_foreign_alloc_thread, NULL);
+    pthread_join(thread, NULL);
+    my_malloc_set_lifetime_learning(0);
+}
+
+// Free more blocks than the thread cache holds with deferred frees enabled
+static void* deferred_free_thread(void* arg) {
+    int use_quiesce = *(int *)arg;
+    void *ptrs[200];
+    my_free_set_deferred(1);
+    for (int i = 0; i < 200; i++) {
+        ptrs[i] = my_malloc(128);
+        assert_non_null(ptrs[i]);
+    }
+    for (int i = 0; i < 200; i++) {
+        my_free(ptrs[i]);
+    }
+
+    // Blocks beyond the thread cache wait in the deferred stack instead of being merged
+    assert_true(__atomic_load_n(&thread_arena->deferred_count, __ATOMIC_RELAXED) > 0);
+
+    if (use_quiesce) {
+        my_malloc_quiesce();
+    } else {
+        // Wait for the maintenance thread to finish merging, the stack is emptied before the merge starts
+        for (int i = 0; i < 1000 && __atomic_load_n(&thread_arena->deferred_count, __ATOMIC_ACQUIRE); i++) {
+            usleep(1000);
+        }
+    }
+    assert_int_equal(__atomic_load_n(&thread_arena->deferred_count, __ATOMIC_ACQUIRE), 0);
+    assert_null(__atomic_load_n(&thread_arena->deferred, __ATOMIC_ACQUIRE));
+
+    // The deferred blocks were merged back into a large free block
+    void *large = my_malloc(ARENA_SIZE / 2);
+    assert_non_null(large);
+    my_free(large);
+
+    my_free_set_deferred(0);
+    return NULL;
+}
+
+// Test that deferred frees are merged at a quiescent point
+static void test_deferred_free_quiesce(void **state) {
+    int use_quiesce = 1;
+    pthread_t thread;
+    pthread_create(&thread, NULL, deferred_free_thread, &use_quiesce);
+    pthread_join(thread, NULL);
+}
+
+// Test that deferred frees are merged by the maintenance thread
+static void test_deferred_free_maintenance(void **state) {
+    int use_quiesce = 0;
+    assert_int_equal(my_malloc_start_maintenance(1), 0);
+    pthread_t thread;
+    pthread_create(&thread, NULL, deferred_free_thread, &use_quiesce);
+    pthread_join(thread, NULL);
+    my_malloc_stop_maintenance();
+}
+
+// Make a category long-lived while its cached blocks are freed in deferred mode
+static void* deferred_lifetime_flush_thread(void* arg) {
+    (void)arg;
+    int class_index = get_lifetime_class(512);
+    void *long_lived[16];
+    void *cached[8];
+    my_free_set_deferred(1);
+    // The 16th automatic allocation of the thread is sampled
+    for (int i = 0; i < 16; i++) {
+        long_lived[i] = my_malloc(512);
+        assert_non_null(long_lived[i]);
+    }
+    // Age the sampled block, the cached blocks below are then allocated at clocks 216 to 223, none of them sampled
+    for (int i = 0; i < 199; i++) {
+        my_free(my_malloc(64));
+    }
+    for (int i = 0; i < 8; i++) {
+        cached[i] = my_malloc(512);
+        assert_non_null(cached[i]);
+    }
+    for (int i = 0; i < 8; i++) {
+        my_free(cached[i]);
+    }
+    for (int i = 0; i < 15; i++) {
+        my_free(long_lived[i]);
+    }
+    assert_int_equal(lifetime_score[class_index], 0);
+    assert_int_equal(__atomic_load_n(&thread_arena->deferred_count, __ATOMIC_RELAXED), 0);
+
+    // Freeing the sampled block makes the category long-lived and flushes its 23 cached blocks
+    my_free(long_lived[15]);
+    assert_true(lifetime_score[class_index] > 0);
+    assert_int_equal(thread_cache.block_count[class_index], 0);
+    // The flushed blocks were deferred instead of being merged inline, plus the sampled block itself
+    assert_int_equal(__atomic_load_n(&thread_arena->deferred_count, __ATOMIC_RELAXED), 24);
+
+    my_malloc_quiesce();
+    assert_int_equal(__atomic_load_n(&thread_arena->deferred_count, __ATOMIC_RELAXED), 0);
+    my_free_set_deferred(0);
+    return NULL;
+}
+
+// Test that a category turning long-lived does not merge cached blocks inline in deferred mode
+static void test_deferred_free_lifetime_flush(void **state) {
+    my_malloc_set_lifetime_learning(1);
+    pthread_t thread;
+    pthread_create(&thread, NULL, deferred_lifetime_flush_thread, NULL);
+    pthread_join(thread, NULL);
+    my_malloc_set_lifetime_learning(0);
+}
+
+// Test that the blocks handed to the merge are sorted by address
+static void test_sort_blocks_by_address(void **state) {
+    block_t blocks[8];
+    int order[8] = {5, 2, 7, 0, 3, 6, 1, 4};
+    block_t *list = NULL;
+    for (int i = 0; i < 8; i++) {
+        blocks[order[i]].next = list;
+        list = &blocks[order[i]];
+    }
+    list = sort_blocks_by_address(list);
+    for (int i = 0; i < 8; i++) {
+        assert_ptr_equal(list, &blocks[i]);
+        list = list->next;
+    }
+    assert_null(list);
+}
+
+// Test that a heap snapshot records block states and survives a write/read round trip
+static void test_heap_snapshot(void **state) {
+    void *ptr = my_malloc(512);
+    assert_non_null(ptr);
+    block_t *block = (block_t *)((char *)ptr - sizeof(block_t));
+
+    heap_snapshot_t *snapshot = take_heap_snapshot();
+    assert_non_null(snapshot);
+    assert_true(snapshot->arena_count >= 1);
+
+    // Find the block in the Arena of this thread
+    arena_t *arena = get_thread_arena();
+    snapshot_arena_t *record = NULL;
+    for (size_t i = 0; i < snapshot->arena_count; i++) {
+        if (snapshot->arenas[i].address == (uint64_t)(uintptr_t)arena->memory) {
+            record = &snapshot->arenas[i];
+        }
+    }
+    assert_non_null(record);
+    int found = 0;
+    size_t covered = 0;
+    for (size_t i = 0; i < record->block_count; i++) {
+        snapshot_block_t *b = &record->blocks[i];
+        assert_int_equal(b->offset, covered); // Records cover the Arena without gaps
+        covered += sizeof(block_t) + b->size;
+        if (b->offset == (uint64_t)((char *)block - (char *)arena->memory)) {
+            assert_int_equal(b->free, 0);
+            assert_true(b->size >= 512);
+            assert_int_equal(b->size_class, get_block_class(b->size));
+            found = 1;
+        }
+    }
+    assert_int_equal(covered, arena->size);
+    assert_true(found);
+
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    assert_int_equal(write_heap_snapshot(snapshot, file), 0);
+    rewind(file);
+    heap_snapshot_t *copy = read_heap_snapshot(file);
+    fclose(file);
+    assert_non_null(copy);
+    assert_int_equal(copy->arena_count, snapshot->arena_count);
+    for (size_t i = 0; i < copy->arena_count; i++) {
+        assert_int_equal(copy->arenas[i].block_count, snapshot->arenas[i].block_count);
+        assert_memory_equal(copy->arenas[i].blocks, snapshot->arenas[i].blocks,
+                            copy->arenas[i].block_count * sizeof(snapshot_block_t));
+    }
+
+    free_heap_snapshot(copy);
+    free_heap_snapshot(snapshot);
+    my_free(ptr);
+}
+
+// Test that corrupted block records are rejected when a snapshot is read
+static void test_heap_snapshot_invalid(void **state) {
+    snapshot_block_t valid = {0, ARENA_SIZE - sizeof(block_t), 1, MAX_BLOCK_CLASSES, {0}};
+    snapshot_block_t invalid[4] = {valid, valid, valid, valid};
+    invalid[0].size_class = 250;          // Unknown category
+    invalid[1].free = 4;                  // Unknown state
+    invalid[2].size = ARENA_SIZE;         // Block ends past the Arena
+    invalid[3].offset = ARENA_SIZE;       // Block starts at the end of the Arena
+
+    for (int i = -1; i < 4; i++) {
+        snapshot_arena_t arena = {0x10000, ARENA_SIZE, 1, i < 0 ? &valid : &invalid[i]};
+        heap_snapshot_t snapshot = {PAGE_SIZE, 1, &arena};
+        FILE *file = tmpfile();
+        assert_non_null(file);
+        assert_int_equal(write_heap_snapshot(&snapshot, file), 0);
+        rewind(file);
+        heap_snapshot_t *copy = read_heap_snapshot(file);
+        fclose(file);
+        if (i < 0) {
+            assert_non_null(copy);
+            free_heap_snapshot(copy);
+        } else {
+            assert_null(copy);
+        }
+    }
+}
+
+#ifdef HEAP_ANALYZER_PATH
+// Run heap_analyzer on a snapshot of one Arena made of the given blocks, the output is stored in output
+static int run_heap_analyzer(snapshot_block_t *blocks, size_t count, const char *width, char *output, size_t length) {
+    snapshot_arena_t arena = {0x10000, ARENA_SIZE, count, blocks};
+    heap_snapshot_t snapshot = {PAGE_SIZE, 1, &arena};
+    char path[] = "/tmp/heap_snapshot_XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    FILE *file = fdopen(fd, "wb");
+    assert_non_null(file);
+    assert_int_equal(write_heap_snapshot(&snapshot, file), 0);
+    fclose(file);
+
+    char command[256];
+    snprintf(command, sizeof(command), "%s %s %s 2>/dev/null", HEAP_ANALYZER_PATH, path, width);
+    FILE *pipe = popen(command, "r");
+    assert_non_null(pipe);
+    size_t read_bytes = fread(output, 1, length - 1, pipe);
+    output[read_bytes] = '\0';
+    int status = pclose(pipe);
+    unlink(path);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Test page utilisation and occupancy map of the analyzer on known layouts
+static void test_heap_analyzer_occupancy(void **state) {
+    char output[4096];
+
+    // A single free block: only its header is allocated
+    snapshot_block_t free_arena[1] = {{0, ARENA_SIZE - sizeof(block_t), 1, MAX_BLOCK_CLASSES, {0}}};
+    assert_int_equal(run_heap_analyzer(free_arena, 1, "16", output, sizeof(output)), 0);
+    assert_non_null(strstr(output, "page utilisation: 0000000000000000\n"));
+    assert_non_null(strstr(output, "pages without allocated bytes: 15/16\n"));
+    assert_non_null(strstr(output, "occupancy map: [+...............]"));
+
+    // The first page is allocated, the rest of the Arena is free
+    snapshot_block_t half[2] = {
+        {0, PAGE_SIZE - sizeof(block_t), 0, get_block_class(PAGE_SIZE - sizeof(block_t)), {0}},
+        {PAGE_SIZE, ARENA_SIZE - PAGE_SIZE - sizeof(block_t), 1, MAX_BLOCK_CLASSES, {0}},
+    };
+    assert_int_equal(run_heap_analyzer(half, 2, "16", output, sizeof(output)), 0);
+    assert_non_null(strstr(output, "page utilisation: 9000000000000000\n"));
+    assert_non_null(strstr(output, "pages without allocated bytes: 14/16\n"));
+    assert_non_null(strstr(output, "occupancy map: [#+..............]"));
+
+    // Four allocated pages, eight pages held in thread caches or deferred free lists, then free space:
+    // each cached page starts with a header but is still shown as cached
+    snapshot_block_t pinned[13];
+    size_t page_block = PAGE_SIZE - sizeof(block_t);
+    for (int i = 0; i < 12; i++) {
+        int state = i < 4 ? 0 : (i < 10 ? 2 : 3);
+        pinned[i] = (snapshot_block_t){(uint64_t)i * PAGE_SIZE, page_block, state, get_block_class(page_block), {0}};
+    }
+    pinned[12] = (snapshot_block_t){12 * PAGE_SIZE, 4 * PAGE_SIZE - sizeof(block_t), 1, MAX_BLOCK_CLASSES, {0}};
+    assert_int_equal(run_heap_analyzer(pinned, 13, "16", output, sizeof(output)), 0);
+    assert_non_null(strstr(output, "occupancy map: [####cccccccc+...]"));
+}
+
+// Test that the analyzer rejects map widths it cannot draw
+static void test_heap_analyzer_invalid_width(void **state) {
+    char output[4096];
+    snapshot_block_t free_arena[1] = {{0, ARENA_SIZE - sizeof(block_t), 1, MAX_BLOCK_CLASSES, {0}}};
+    const char *widths[] = {"-5", "0", "abc", "16x", "100000", "99999999999999999999"};
+    for (size_t i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+        assert_int_equal(run_heap_analyzer(free_arena, 1, widths[i], output, sizeof(output)), 1);
+        assert_null(strstr(output, "occupancy map"));
+    }
+}
+#endif
+
+// Test handing off a block allocated by a child process to its parent as an offset
+static void test_shared_arena_handoff(void **state) {
+    char name[64];
+    snprintf(name, sizeof(name), "/myAllocator-test-%d-handoff", (int)getpid());
+    shared_arena_t* arena = shared_arena_create(name, ARENA_SIZE);
+    assert_non_null(arena);
+
+    int fds[2];
+    assert_int_equal(pipe(fds), 0);
+
+    pid_t pid = fork();
+    assert_true(pid >= 0);
+    if (pid == 0) {
+        // Child: map the Arena again by name, the inherited mapping stays in place so the new one
+        // gets another address, then allocate and fill a buffer and only send its offset
+        shared_arena_t* child_arena = shared_arena_attach(name);
+        size_t message[2] = {0, (size_t)(uintptr_t)child_arena};
+        if (child_arena) {
+            message[0] = shared_malloc(child_arena, 256);
+            char* data = (char*)shared_offset_to_ptr(child_arena, message[0]);
+            if (data) {
+                for (size_t i = 0; i < 256; i++) {
+                    data[i] = (char)(i % 256);
+                }
+            }
+            shared_arena_detach(child_arena);
+        }
+        _exit(write(fds[1], message, sizeof(message)) == sizeof(message) ? 0 : 1);
+    }
+
+    size_t message[2] = {0, 0};
+    assert_int_equal(read(fds[0], message, sizeof(message)), sizeof(message));
+    int status;
+    waitpid(pid, &status, 0);
+    assert_int_equal(WEXITSTATUS(status), 0);
+    size_t offset = message[0];
+    assert_int_not_equal(offset, 0);
+    // The block was allocated through a mapping at a different address
+    assert_int_not_equal(message[1], 0);
+    assert_int_not_equal(message[1], (size_t)(uintptr_t)arena);
+
+    // Parent: consume the data in place and release it
+    char* data = (char*)shared_offset_to_ptr(arena, offset);
+    for (size_t i = 0; i < 256; i++) {
+        assert_int_equal(data[i], (char)(i % 256));
+    }
+    shared_free(arena, offset);
+
+    // The released block should be reused for the next allocation of the same size
+    assert_int_equal(shared_malloc(arena, 256), offset);
+    shared_free(arena, offset);
+
+    close(fds[0]);
+    close(fds[1]);
+    shared_arena_detach(arena);
+    shm_unlink(name);
+}
+
+// Test concurrent allocations from several processes in the same shared Arena
+static void test_shared_arena_multiprocess(void **state) {
+    char name[64];
+    snprintf(name, sizeof(name), "/myAllocator-test-%d-multiprocess", (int)getpid());
+    shared_arena_t* arena = shared_arena_create(name, ARENA_SIZE);
+    assert_non_null(arena);
+
+    pid_t pids[4];
+    for (int p = 0; p < 4; p++) {
+        pids[p] = fork();
+        assert_true(pids[p] >= 0);
+        if (pids[p] == 0) {
+            // Each child uses its own mapping of the Arena, at a different address than the parent's
+            shared_arena_t* child_arena = shared_arena_attach(name);
+            if (child_arena == NULL || child_arena == arena) {
+                _exit(3);
+            }
+            for (int i = 0; i < 1000; i++) {
+                size_t size = 16 + (size_t)((i * 37 + p * 11) % 1024);
+                size_t offset = shared_malloc(child_arena, size);
+                if (offset == 0) {
+                    _exit(1);
+                }
+                memset(shared_offset_to_ptr(child_arena, offset), p, size);
+                for (size_t j = 0; j < size; j++) {
+                    if (((char*)shared_offset_to_ptr(child_arena, offset))[j] != (char)p) {
+                        _exit(2);
+                    }
+                }
+                shared_free(child_arena, offset);
+            }
+            _exit(0);
+        }
+    }
+    for (int p = 0; p < 4; p++) {
+        int status;
+        waitpid(pids[p], &status, 0);
+        assert_true(WIFEXITED(status));
+        assert_int_equal(WEXITSTATUS(status), 0);
+    }
+
+    // Everything was released, so the free blocks must have merged back into one
+    size_t offset = shared_malloc(arena, arena->size - arena->memory - sizeof(shared_block_t));
+    assert_int_not_equal(offset, 0);
+    shared_free(arena, offset);
+
+    shared_arena_detach(arena);
+    shm_unlink(name);
+}
+
+// Test that sizes which do not fit in a shared Arena are rejected, including ones that wrap when aligned
+static void test_shared_malloc_invalid(void **state) {
+    shared_arena_t* arena = shared_arena_create(NULL, ARENA_SIZE);
+    assert_non_null(arena);
+    assert_int_equal(shared_malloc(arena, SIZE_MAX), 0);
+    assert_int_equal(shared_malloc(arena, SIZE_MAX - ALIGNMENT + 2), 0);
+    assert_int_equal(shared_malloc(arena, arena->size), 0);
+    shared_arena_detach(arena);
+}
+
+// Test that shared_free ignores offsets outside the blocks and double frees
+static void test_shared_free_invalid(void **state) {
+    shared_arena_t* arena = shared_arena_create(NULL, ARENA_SIZE);
+    assert_non_null(arena);
+    size_t offset = shared_malloc(arena, 256);
+    assert_int_not_equal(offset, 0);
+
+    shared_free(arena, 8);                    // Inside the Arena header
+    shared_free(arena, arena->memory);        // Header of the first block
+    shared_free(arena, arena->size);          // Past the end of the Arena
+    shared_free(arena, arena->size + 4096);
+    shared_free(arena, offset + 8);           // Misaligned
+    shared_free(arena, offset);
+    shared_free(arena, offset);               // Double free
+
+    // Offsets inside a live block whose bytes look like an allocated header
+    size_t first = shared_malloc(arena, 256);
+    size_t second = shared_malloc(arena, 256);
+    assert_int_not_equal(first, 0);
+    assert_int_not_equal(second, 0);
+    shared_free(arena, first);
+    shared_free(arena, second);
+    size_t merged = shared_malloc(arena, 1024);
+    assert_int_equal(merged, first);
+    shared_block_t forged = {256, 0, 0, 0};
+    memcpy((char*)shared_offset_to_ptr(arena, merged) + 512 - sizeof(shared_block_t), &forged, sizeof(forged));
+    shared_free(arena, second);               // Stale double free, the old header is still in the payload
+    shared_free(arena, merged + 512);         // Aligned offset forged inside the live block
+    size_t others[2];
+    for (int i = 0; i < 2; i++) {
+        others[i] = shared_malloc(arena, 256);
+        assert_true(others[i] >= merged + 1024 || others[i] + 256 <= merged);
+    }
+    shared_free(arena, others[0]);
+    shared_free(arena, others[1]);
+    shared_free(arena, merged);
+
+    // The Arena is whole again and holds exactly one block
+    size_t whole = shared_malloc(arena, arena->size - arena->memory - sizeof(shared_block_t));
+    assert_int_not_equal(whole, 0);
+    assert_int_equal(shared_malloc(arena, 16), 0);
+    shared_free(arena, whole);
+
+    shared_arena_detach(arena);
+}
+
+// Test that the free lists are rebuilt when a process dies in the middle of a free
+static void test_shared_arena_owner_died(void **state) {
+    shared_arena_t* arena = shared_arena_create(NULL, ARENA_SIZE);
+    assert_non_null(arena);
+    size_t first = shared_malloc(arena, 256);
+    size_t second = shared_malloc(arena, 256);
+    assert_int_not_equal(first, 0);
+    assert_int_not_equal(second, 0);
+
+    pid_t pid = fork();
+    assert_true(pid >= 0);
+    if (pid == 0) {
+        // Child: die holding the lock after marking a block free, before relinking the free lists
+        if (shared_arena_lock(arena) != 0) {
+            _exit(1);
+        }
+        SHARED_BLOCK(arena, first - sizeof(shared_block_t))->free = 1;
+        for (int i = 0; i <= MAX_BLOCK_CLASSES; i++) {
+            arena->free_list[i] = 0;
+        }
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert_int_equal(WEXITSTATUS(status), 0);
+
+    // Both the block freed by the dead process and the rest of the Arena are allocatable again
+    assert_int_equal(shared_malloc(arena, 256), first);
+    size_t rest = shared_malloc(arena, arena->size - second - 256 - sizeof(shared_block_t));
+    assert_int_not_equal(rest, 0);
+    shared_free(arena, rest);
+    shared_free(arena, second);
+    shared_free(arena, first);
+    size_t offset = shared_malloc(arena, arena->size - arena->memory - sizeof(shared_block_t));
+    assert_int_not_equal(offset, 0);
+    shared_free(arena, offset);
+
+    shared_arena_detach(arena);
+}
+
+// Test that a shared Arena whose block headers were corrupted by a dead process is not used again
+static void test_shared_arena_owner_died_corrupted(void **state) {
+    shared_arena_t* arena = shared_arena_create(NULL, ARENA_SIZE);
+    assert_non_null(arena);
+    size_t offset = shared_malloc(arena, 256);
+    assert_int_not_equal(offset, 0);
+
+    pid_t pid = fork();
+    assert_true(pid >= 0);
+    if (pid == 0) {
+        // Child: die holding the lock after writing a block size that overruns the Arena
+        if (shared_arena_lock(arena) != 0) {
+            _exit(1);
+        }
+        SHARED_BLOCK(arena, offset - sizeof(shared_block_t))->size = arena->size;
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert_int_equal(WEXITSTATUS(status), 0);
+
+    assert_int_equal(shared_malloc(arena, 256), 0);
+    assert_int_equal(shared_arena_lock(arena), ENOTRECOVERABLE);
+    assert_int_equal(shared_malloc(arena, 256), 0);
+
+    shared_arena_detach(arena);
+}
+
 // Define the test suite
 int main(void) {
     const struct CMUnitTest tests[] = {
@@ -150,6 +815,27 @@ int main(void) {
             cmocka_unit_test(test_my_free),
             cmocka_unit_test(test_memory_write),
             cmocka_unit_test(test_block_coalescing),
+            cmocka_unit_test(test_thread_cache_reuse),
+            cmocka_unit_test(test_lifetime_hint),
+            cmocka_unit_test(test_lifetime_hint_fallback),
+            cmocka_unit_test(test_lifetime_learning),
+            cmocka_unit_test(test_lifetime_foreign_free),
+            cmocka_unit_test(test_deferred_free_quiesce),
+            cmocka_unit_test(test_deferred_free_maintenance),
+            cmocka_unit_test(test_deferred_free_lifetime_flush),
+            cmocka_unit_test(test_sort_blocks_by_address),
+            cmocka_unit_test(test_heap_snapshot),
+            cmocka_unit_test(test_heap_snapshot_invalid),
+#ifdef HEAP_ANALYZER_PATH
+            cmocka_unit_test(test_heap_analyzer_occupancy),
+            cmocka_unit_test(test_heap_analyzer_invalid_width),
+#endif
+            cmocka_unit_test(test_shared_arena_handoff),
+            cmocka_unit_test(test_shared_arena_multiprocess),
+            cmocka_unit_test(test_shared_malloc_invalid),
+            cmocka_unit_test(test_shared_free_invalid),
+            cmocka_unit_test(test_shared_arena_owner_died),
+            cmocka_unit_test(test_shared_arena_owner_died_corrupted),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);